@@ -3,17 +3,21 @@
 
 u64 hash_int(const kind_t *k, void *i) { return *cast(i32, i); }
 u64 hash_char(const kind_t *k, void *i) { return *cast(char, i); }
+i32 cmp_int(const kind_t *k, void *a, void *b) {
+  return *cast(i32, a) - *cast(i32, b);
+}
 
 i32 main() {
   kind_t int_kind = {
       .item_size = sizeof(i32),
       .allocator = mem_default,
       .hasher = hash_int,
+      .comparer = cmp_int,
   };
 
   kind_t char_kind = {
       .item_size = sizeof(char),
-      .allocator = mem_default,
+      .allocator = mem_cached,
       .hasher = hash_char,
   };
 
@@ -56,6 +60,9 @@ i32 main() {
 
   dict_t *int_dict = unwrap(dict_t, dict_create(&int_kind, &int_kind));
 
+  // Lookups of missing keys are answered by the filter.
+  try(dict_filter(int_dict));
+
   for (i32 i = 0; i < 16; i++) {
     try(dict_set(int_dict, &i, &i));
 
@@ -63,11 +70,111 @@ i32 main() {
     printf("got: %i\n", *c);
   }
 
+  kind_t ptr_kind = {
+      .item_size = sizeof(void *),
+      .allocator = mem_default,
+  };
+
+  i32 probes[] = {3, 69, 12};
+  view_t *probe_view = unwrap(view_t, view_create(&int_kind, probes, 3));
+  array_t *found = unwrap(array_t, array_create(&ptr_kind));
+
+  try(dict_get_many(int_dict, probe_view, found));
+
+  array_each_as(found, f, {
+    i32 *val = *cast(i32 *, f);
+    printf("found: %i\n", val ? *val : -1);
+  });
+
+  array_destroy(found);
+  view_destroy(probe_view);
+
+  i32 missing = 69;
+  printf("has %i: %i\n", missing, dict_get(int_dict, &missing).data != NULL);
+
   dict_each_as(int_dict, k, v,
                printf("k(%i), v(%i)\n", *cast(i32, k), *cast(i32, v)));
 
   dict_destroy(int_dict);
 
+  cdict_t *ordered = unwrap(cdict_t, cdict_create(&int_kind, &int_kind));
+
+  for (i32 i = 8; i > 0; i--) {
+    try(cdict_set(ordered, &i, &b));
+    if (i % 2)
+      try(cdict_remove(ordered, &i));
+  }
+
+  cdict_each_as(ordered, k, v,
+                printf("k(%i), v(%i) ", *cast(i32, k), *cast(i32, v)));
+  printf("\n");
+
+  cdict_destroy(ordered);
+
+  i32 evens[] = {0, 2, 4, 6, 8};
+  view_t *even_view = unwrap(view_t, view_create(&int_kind, evens, 5));
+
+  set_t *small = unwrap(set_t, set_create(&int_kind));
+  set_t *even = unwrap(set_t, set_create(&int_kind));
+
+  for (i32 i = 0; i < 5; i++)
+    try(set_insert(small, &i));
+
+  try(set_insert_view(even, even_view));
+
+  set_t *small_odd = unwrap(set_t, set_difference(small, even));
+
+  set_each_as(small_odd, k, printf("odd(%i) ", *cast(i32, k)));
+  printf("\n");
+
+  set_destroy(small_odd);
+  set_destroy(even);
+  set_destroy(small);
+  view_destroy(even_view);
+
+  kind_t id_kind = {
+      .item_size = sizeof(u64),
+      .allocator = mem_default,
+  };
+
+  array_t *ids = unwrap(array_t, array_create(&id_kind));
+
+  for (u64 i = 0; i < 1000; i++) {
+    u64 id = 1000000 + i * 3;
+    try(array_emplace(ids, &id));
+  }
+
+  packed_t *packed_ids = unwrap(packed_t, packed_from_array(ids, PACK_BITS));
+
+  u64 id;
+  try(packed_get(packed_ids, 500, &id));
+  printf("id: %lu\n", id);
+
+  u64 total = 0;
+  packed_each_as(packed_ids, i, total += i);
+  printf("total: %lu\n", total);
+
+  packed_destroy(packed_ids);
+  array_destroy(ids);
+
+  heap_t *int_heap = unwrap(heap_t, heap_create_indexed(&int_kind));
+
+  u64 handle;
+  for (i32 i = 0; i < 8; i++) {
+    i32 item = (i * 5) % 8;
+    try(heap_insert(int_heap, &item, &handle));
+  }
+
+  // Move the last item to the front of the queue.
+  try(heap_decrease(int_heap, handle, &b));
+
+  printf("[");
+  while (int_heap->items->len)
+    printf(" %i", *unwrap(i32, heap_pop(int_heap)));
+  printf(" ]\n");
+
+  heap_destroy(int_heap);
+
   v2_f64_t fs = {.f64s = {69, .420}};
 
   fs = v2_f64_addv(fs, fs);
@@ -84,6 +191,23 @@ i32 main() {
 
   printf("%lf\n", v2_f64_dot(fs, fs));
 
+  kind_t vec_kind = {
+      .item_size = sizeof(v4_f32_t),
+      .alignment = 32,
+      .allocator = mem_default,
+  };
+
+  array_t *vecs = unwrap(array_t, array_create(&vec_kind));
+
+  for (i32 i = 0; i < 4; i++) {
+    v4_f32_t *vec = unwrap(v4_f32_t, array_append(vecs));
+    *vec = (v4_f32_t){.f32s = {i, i, i, i}};
+  }
+
+  printf("aligned: %i\n", (uintptr_t)vecs->data % vec_kind.alignment == 0);
+
+  array_destroy(vecs);
+
   char *path_name = "../README.md";
 
   view_t *path =
@@ -94,4 +218,15 @@ i32 main() {
   array_t *readme = unwrap(array_t, io_readfile(path));
 
   array_each_as(readme, i, printf("%c", *cast(char, i)));
+
+  view_t *text = unwrap(view_t, array_view(readme, 0, readme->len));
+
+  printf("lines: %lu\n", view_count_byte(text, '\n'));
+
+  view_split_as(text, '\n', line, {
+    if (line.len)
+      printf("%.*s|\n", (i32)line.len, line.data);
+  });
+
+  view_destroy(text);
 }
@@ -13,11 +13,16 @@
 /* ------------ TYPES ------------ */
 #include <assert.h>
 #include <stddef.h>
+#include <stdatomic.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
 typedef uint8_t u8;
 typedef uint16_t u16;
 typedef uint32_t u32;
@@ -101,18 +106,55 @@ typedef result_t (*mem_fn)(const kind_t *, void *, u64);
 
 result_t mem_default(const kind_t *kind, void *, u64 len);
 
+// Allocate from per thread caches of size classed blocks, which spill into
+// a shared pool. Blocks past the pool's limit are returned to malloc.
+result_t mem_cached(const kind_t *kind, void *, u64 len);
+
+// Hand the calling thread's cached blocks to the shared pool, before the
+// thread exits.
+void mem_cached_flush(void);
+
+// Block sizes are powers of two, from MEM_MIN_CLASS up to 64KiB.
+#define MEM_CLASSES 13
+
+#define MEM_MIN_CLASS 16
+
+// Blocks a thread may cache per class, before it spills a batch.
+#define MEM_CACHE_LIMIT 64
+
+#define MEM_BATCH 32
+
+// Blocks the shared pool keeps per class, before it frees the rest.
+#define MEM_POOL_LIMIT 1024
+
+// The most pauses a thread waits between attempts at the pool's lock.
+#define MEM_MAX_BACKOFF 64
+
 typedef u64 (*hash_fn)(const kind_t *, void *);
 
+// Negative if the first item orders before the second, zero if they are equal.
+typedef i32 (*cmp_fn)(const kind_t *, void *, void *);
+
 #define size(self) (self->kind->item_size)
 
-#define alloc(kind, ptr, size)                                                 \
-  ((kind)->allocator((kind), ptr, size * (kind)->item_size))
+// Allocators take a count of items, and scale it by the kind's item_size.
+#define alloc(kind, ptr, size) ((kind)->allocator((kind), ptr, size))
+
+// Allocate room for a number of bytes, rounded up to whole items.
+#define alloc_bytes(kind, ptr, bytes)                                          \
+  alloc(kind, ptr, ((bytes) + (kind)->item_size - 1) / (kind)->item_size)
 
 #define copy(kind, dest, src, size)                                            \
   (memcpy(dest, src, size * (kind)->item_size))
 
 #define hash(kind, ptr) ((kind)->hasher((kind), ptr))
 
+#define compare(kind, a, b) ((kind)->comparer((kind), a, b))
+
+#define align_up(n, align) (((n) + (align)-1) / (align) * (align))
+
+u64 kind_align(const kind_t *);
+
 /* ------------ VECTORS ------------ */
 // Macro for concatenating the vector type names easier.
 #define vec_name(type, size) v##size##_##type##_t
@@ -210,6 +252,80 @@ result_t view_get(view_t *, u64);
     body;                                                                      \
   }
 
+// The byte routines below expect a view whose kind has an item_size of 1.
+// They use AVX2 or SSE2 when the compiler targets them. There is no runtime
+// dispatch, and the default x86-64 build only gets SSE2, so build with
+// -mavx2 (or -march=native) for the wider paths.
+
+// Return a pointer to the first matching byte, or NULL if there is none.
+result_t view_find_byte(view_t *, u8);
+
+// Return a pointer to the first byte found in the given set, or NULL. Sets
+// larger than VIEW_ANY_MAX are matched through a lookup table instead.
+result_t view_find_any(view_t *, const u8 *, u64);
+
+#define VIEW_ANY_MAX 8
+
+u64 view_count_byte(view_t *, u8);
+
+boolean view_equals(view_t *, view_t *);
+
+boolean view_starts_with(view_t *, view_t *);
+
+/* ------------ SPLITS ------------ */
+typedef struct split_s split_t;
+
+split_t view_split(view_t *, u8);
+
+// Write the next piece into the given view, false once there are none left.
+boolean split_next(split_t *, view_t *);
+
+#define view_split_as(view, delim, var, body)                                  \
+  {                                                                            \
+    split_t __split = view_split(view, delim);                                 \
+    view_t var;                                                                \
+    while (split_next(&__split, &var)) {                                       \
+      body;                                                                    \
+    }                                                                          \
+  }
+
+/* ------------ FILTERS ------------ */
+// Approximate membership over a key kind's hasher. A miss is always
+// correct, a hit may be a false positive.
+typedef struct bloom_s bloom_t;
+
+typedef struct cuckoo_s cuckoo_t;
+
+// A blocked bloom filter, every key lives in a single cache line.
+result_t bloom_create(kind_t *, u64);
+
+result_t bloom_destroy(bloom_t *);
+
+result_t bloom_add(bloom_t *, void *);
+
+boolean bloom_has(bloom_t *, void *);
+
+// A cuckoo filter, which unlike a bloom filter supports removal.
+result_t cuckoo_create(kind_t *, u64);
+
+result_t cuckoo_destroy(cuckoo_t *);
+
+// Fails with a MEMORY_ERR once the filter is full.
+result_t cuckoo_add(cuckoo_t *, void *);
+
+boolean cuckoo_has(cuckoo_t *, void *);
+
+// Only remove keys which were added, or other keys may go missing.
+boolean cuckoo_remove(cuckoo_t *, void *);
+
+#define BLOOM_BITS_PER_KEY 10
+
+#define BLOOM_BLOCK_SIZE 64
+
+#define CUCKOO_BUCKET_SIZE 4
+
+#define CUCKOO_MAX_KICKS 500
+
 /* ------------ DICTIONARIES------------ */
 typedef struct dict_s dict_t;
 
@@ -223,17 +339,179 @@ result_t dict_set(dict_t *, void *, void *);
 
 result_t dict_get(dict_t *, void *);
 
+// Look up every key of a view, appending a pointer to each value (or NULL
+// when it is missing) to an array whose kind has the size of a pointer.
+result_t dict_get_many(dict_t *, view_t *, array_t *);
+
+// Set every key of a view to the value at the same offset of another.
+result_t dict_set_many(dict_t *, view_t *, view_t *);
+
+// Attach a bloom filter, so lookups of missing keys skip the probe.
+result_t dict_filter(dict_t *);
+
 #define DICT_LOAD 0.7
 
+// Batched lookups hash this many keys at a time, then test the filter and
+// prefetch buckets DICT_PREFETCH keys ahead of the one being resolved.
+#define DICT_BATCH 64
+
+#define DICT_PREFETCH 8
+
+#define DICT_MISS UINT64_MAX
+
 #define dict_each_as(d, key, val, body)                                        \
   for (u64 __i = 0; __i < d->cap; __i++) {                                     \
     u8 *__bucket = d->data + __i * d->internal_kind.item_size;                 \
-    void *key = __bucket + 1;                                                  \
-    void *val = __bucket + 1 + d->key_kind->item_size;                         \
-    if (__bucket[0])                                                           \
+    void *key = __bucket;                                                      \
+    void *val = __bucket + d->val_offset;                                      \
+    if (__bucket[d->used_offset])                                              \
+      body;                                                                    \
+  }
+
+/* ------------ COMPACT DICTIONARIES ------------ */
+// A dict which keeps its entries densely, in insertion order, behind a
+// small index of 8, 16, 32 or 64 bit entry numbers.
+typedef struct cdict_s cdict_t;
+
+result_t cdict_create(kind_t *, kind_t *);
+
+result_t cdict_destroy(cdict_t *);
+
+boolean cdict_has_key(cdict_t *, void *);
+
+result_t cdict_set(cdict_t *, void *, void *);
+
+result_t cdict_get(cdict_t *, void *);
+
+// Fails with a BOUNDS_ERR if the key does not exist.
+result_t cdict_remove(cdict_t *, void *);
+
+#define cdict_each_as(d, key, val, body)                                       \
+  for (u64 __i = 0; __i < d->entries->len; __i++) {                            \
+    u8 *__entry = d->entries->data + __i * d->entry_kind.item_size;            \
+    void *key = __entry;                                                       \
+    void *val = __entry + d->val_offset;                                       \
+    if (__entry[d->used_offset])                                               \
+      body;                                                                    \
+  }
+
+/* ------------ SETS ------------ */
+typedef struct set_s set_t;
+
+result_t set_create(kind_t *);
+
+result_t set_destroy(set_t *);
+
+result_t set_insert(set_t *, void *);
+
+// Insert every item of a view, whose kind has the set's item_size.
+result_t set_insert_view(set_t *, view_t *);
+
+boolean set_contains(set_t *, void *);
+
+// Fails with a BOUNDS_ERR if the key does not exist.
+result_t set_remove(set_t *, void *);
+
+// These create a new set, of the first set's kind.
+result_t set_union(set_t *, set_t *);
+
+result_t set_intersection(set_t *, set_t *);
+
+result_t set_difference(set_t *, set_t *);
+
+#define set_each_as(s, key, body)                                              \
+  for (u64 __i = 0; __i < s->cap; __i++) {                                     \
+    u8 *__bucket = s->data + __i * s->internal_kind.item_size;                 \
+    void *key = __bucket;                                                      \
+    if (__bucket[s->kind->item_size])                                          \
       body;                                                                    \
   }
 
+/* ------------ PACKED INTEGERS ------------ */
+// A read only, compressed array of u64s, stored in blocks of PACK_BLOCK.
+typedef struct packed_s packed_t;
+
+typedef struct pack_block_s pack_block_t;
+
+// How the blocks of a packed array are encoded.
+typedef enum pack_e {
+  // Offsets from the block's minimum, bit packed at the block's width.
+  PACK_BITS,
+  // Zigzag encoded deltas from the previous value, as varints.
+  PACK_VARINT,
+} pack_k;
+
+// Pack a view, whose kind should have an item_size of 8.
+result_t packed_create(view_t *, pack_k);
+
+result_t packed_from_array(array_t *, pack_k);
+
+result_t packed_destroy(packed_t *);
+
+// Write the value at an offset into the last argument.
+result_t packed_get(packed_t *, u64, u64 *);
+
+// Decode a block into PACK_BLOCK u64s, returning how many are in use.
+// Bit packed blocks unpack with AVX2 or SSE2 when the compiler targets them.
+u64 packed_block(packed_t *, u64, u64 *);
+
+#define PACK_BLOCK 128
+
+// Bit packed values are interleaved across this many lanes, so that a
+// whole vector of them unpacks at once.
+#define PACK_LANES 4
+
+#define packed_each_block_as(p, values, count, body)                           \
+  for (u64 __b = 0; __b < p->blocks; __b++) {                                  \
+    u64 values[PACK_BLOCK];                                                    \
+    u64 count = packed_block(p, __b, values);                                  \
+    body;                                                                      \
+  }
+
+#define packed_each_as(p, var, body)                                           \
+  packed_each_block_as(p, __values, __count, {                                 \
+    for (u64 __i = 0; __i < __count; __i++) {                                  \
+      u64 var = __values[__i];                                                 \
+      body;                                                                    \
+    }                                                                          \
+  })
+
+/* ------------ HEAPS ------------ */
+// A min-heap ordered by the kind's comparer.
+typedef struct heap_s heap_t;
+
+result_t heap_create(kind_t *);
+
+// Create a heap which hands out handles for heap_decrease.
+result_t heap_create_indexed(kind_t *);
+
+// Build a heap from a copy of the array's items in O(n).
+result_t heap_from_array(array_t *);
+
+result_t heap_destroy(heap_t *);
+
+result_t heap_push(heap_t *, void *);
+
+// Push an item and write its handle into the last argument. Handles are
+// reused once their item is popped, with a new generation in the top bits,
+// so a stale handle is still rejected.
+result_t heap_insert(heap_t *, void *, u64 *);
+
+result_t heap_peek(heap_t *);
+
+// The popped item stays valid until the next push.
+result_t heap_pop(heap_t *);
+
+// Replace the item behind a handle, usually with a smaller one.
+result_t heap_decrease(heap_t *, u64, void *);
+
+#define HEAP_ARITY 4
+
+#define HEAP_NONE UINT64_MAX
+
+// Handles keep their slot in the low bits, and its generation above them.
+#define HEAP_SLOT_BITS 32
+
 //////////////////////////////
 //                          //
 //        FILE I/O          //
@@ -254,8 +532,13 @@ result_t io_readfile(view_t *);
 /* ------------ STRUCT DEFINITIONS ------------ */
 struct kind_s {
   u64 item_size;
+
+  // Zero for the natural alignment of item_size. Items are only aligned
+  // individually when item_size is a multiple of the alignment.
+  u64 alignment;
   mem_fn allocator;
   hash_fn hasher;
+  cmp_fn comparer;
 
   void *user_data;
   const char *user_name;
@@ -280,6 +563,12 @@ struct view_s {
   u64 len;
 };
 
+struct split_s {
+  view_t rest;
+  u8 delim;
+  boolean done;
+};
+
 struct array_s {
   kind_t *kind;
 
@@ -295,6 +584,91 @@ struct dict_s {
   kind_t *key_kind;
   kind_t *val_kind;
   kind_t internal_kind;
+  bloom_t *filter;
+
+  // Buckets hold the key, then the value, then the used flag, each aligned.
+  u64 val_offset;
+  u64 used_offset;
+};
+
+struct bloom_s {
+  u8 *data;
+  u64 blocks;
+  kind_t *key_kind;
+  kind_t block_kind;
+};
+
+struct cuckoo_s {
+  u16 *data;
+  u64 mask;
+  u64 len;
+  kind_t *key_kind;
+  kind_t bucket_kind;
+
+  // A fingerprint which could not be placed once the filter filled up.
+  u16 victim;
+  u64 victim_index;
+};
+
+struct cdict_s {
+  array_t *entries;
+  u64 len;
+  kind_t *key_kind;
+  kind_t *val_kind;
+  kind_t entry_kind;
+
+  // Index slots are 0 when empty, 1 when removed, or an entry number + 2.
+  u8 *index;
+  u64 cap;
+  u64 width;
+  kind_t index_kind;
+
+  u64 val_offset;
+  u64 used_offset;
+};
+
+struct set_s {
+  u8 *data;
+  u64 cap;
+  u64 len;
+  kind_t *kind;
+
+  // Buckets hold the key, followed by the used flag.
+  kind_t internal_kind;
+};
+
+struct pack_block_s {
+  // The block's minimum for PACK_BITS, or its first value for PACK_VARINT.
+  u64 base;
+  // Where the block's bytes start in the packed data.
+  u64 offset;
+  u64 width;
+};
+
+struct packed_s {
+  pack_k mode;
+  u64 len;
+  u64 blocks;
+
+  pack_block_t *headers;
+  u8 *data;
+
+  kind_t header_kind;
+  kind_t data_kind;
+};
+
+struct heap_s {
+  array_t *items;
+  u8 *scratch;
+
+  // Only used by indexed heaps, NULL otherwise.
+  array_t *ids;
+  array_t *positions;
+  // How many times each slot has been handed out, and the slots whose
+  // items were popped, ready to be handed out again.
+  array_t *generations;
+  array_t *free_ids;
+  kind_t index_kind;
 };
 
 #define vec_union_2def(type)                                                   \
@@ -353,7 +727,61 @@ function i32 fail(const char *file, const u32 line, const char *fmt) {
   return 1;
 }
 
+function u64 kind_align(const kind_t *kind) {
+  if (kind->alignment)
+    return kind->alignment;
+
+  // The largest power of two dividing the size, up to malloc's alignment.
+  u64 natural = kind->item_size & -kind->item_size;
+
+  if (natural == 0 || natural > _Alignof(max_align_t))
+    return _Alignof(max_align_t);
+
+  return natural;
+}
+
+// Allocate for kinds aligned beyond malloc. realloc can't keep such an
+// alignment, so each block records its size in the padding just before it,
+// and growing moves it to a fresh aligned block.
+function result_t mem_aligned(const kind_t *kind, void *ptr, u64 len) {
+  u64 align = kind->alignment;
+
+  if (len == 0) {
+    if (ptr)
+      free(cast(u8, ptr) - align);
+
+    return ok(NULL);
+  }
+
+  u64 bytes = kind->item_size * len;
+  u64 old_bytes = ptr ? cast(u64, ptr)[-1] : 0;
+
+  // Shrinking keeps the block.
+  if (ptr && bytes <= old_bytes)
+    return ok(ptr);
+
+  u8 *base = aligned_alloc(align, align + align_up(bytes, align));
+
+  if (base == NULL)
+    return err(MEMORY_ERR);
+
+  u8 *result = base + align;
+  cast(u64, result)[-1] = bytes;
+
+  if (ptr) {
+    memcpy(result, ptr, old_bytes);
+    free(cast(u8, ptr) - align);
+  }
+
+  return ok(result);
+}
+
 function result_t mem_default(const kind_t *kind, void *ptr, u64 len) {
+  check((kind->alignment & (kind->alignment - 1)) == 0,
+        "Alignment should be a power of two");
+
+  if (kind->alignment > _Alignof(max_align_t))
+    return mem_aligned(kind, ptr, len);
 
   if (len == 0) {
     free(ptr);
@@ -368,144 +796,385 @@ function result_t mem_default(const kind_t *kind, void *ptr, u64 len) {
   return ok(result);
 }
 
-function result_t grow_array(array_t *self) {
-
-  self->cap *= 2;
+/* ------------ CACHED ALLOCATOR ------------ */
 
-  result_t result = alloc(self->kind, self->data, self->cap);
+// Each block is preceded by its class and its capacity in bytes.
+#define MEM_HEADER _Alignof(max_align_t)
 
-  self->data = unwrap(u8, result);
+#define MEM_LARGE MEM_CLASSES
 
-  return ok(NULL);
-}
+#define mem_class_size(class) ((u64)MEM_MIN_CLASS << (class))
 
-function result_t grow_dict(dict_t *self) {
+#define mem_header(ptr) cast(u64, (cast(u8, ptr) - MEM_HEADER))
 
-  // Save a ref to the old array of data.
-  u8 *old_data = self->data;
-  u64 old_cap = self->cap;
+typedef struct mem_block_s mem_block_t;
 
-  // Increase the capacity, reset the length, and reserve a new array.
-  self->cap *= 2;
-  self->len = 0;
+struct mem_block_s {
+  mem_block_t *next;
+};
 
-  result_t result = alloc(&self->internal_kind, NULL, self->cap);
+static _Thread_local mem_block_t *mem_cache[MEM_CLASSES];
+static _Thread_local u64 mem_cache_len[MEM_CLASSES];
 
-  self->data = unwrap(u8, result);
+static mem_block_t *mem_pool[MEM_CLASSES];
+static u64 mem_pool_len[MEM_CLASSES];
+static atomic_int mem_pool_lock;
 
-  // For each kvp in the old array, insert it into the new dict.
-  for (u64 i = 0; i < old_cap; i++) {
-    u8 *bucket = old_data + i * self->internal_kind.item_size;
-    void *key = bucket + 1;
-    void *val = bucket + 1 + self->key_kind->item_size;
+#if defined(__SSE2__)
+#define mem_pause() _mm_pause()
+#elif defined(__aarch64__)
+#define mem_pause() __asm__ volatile("yield")
+#else
+#define mem_pause() ((void)0)
+#endif
 
-    if (bucket[0]) {
-      dict_set(self, key, val);
-    }
+function u64 mem_class(u64 bytes) {
+  for (u64 class = 0; class < MEM_CLASSES; class++) {
+    if (bytes <= mem_class_size(class))
+      return class;
   }
 
-  try(alloc(&self->internal_kind, old_data, 0));
+  return MEM_LARGE;
+}
 
-  return ok(NULL);
+function void lock_mem_pool(void) {
+  u64 backoff = 1;
+
+  while (atomic_exchange_explicit(&mem_pool_lock, 1, memory_order_acquire)) {
+    // Wait until the lock looks free before trying again, pausing longer
+    // each round so waiting threads don't fight over its cache line.
+    do {
+      for (u64 i = 0; i < backoff; i++) {
+        mem_pause();
+      }
+
+      if (backoff < MEM_MAX_BACKOFF)
+        backoff *= 2;
+    } while (atomic_load_explicit(&mem_pool_lock, memory_order_relaxed));
+  }
 }
 
-/* ------------ arrayS ------------ */
+function void unlock_mem_pool(void) {
+  atomic_store_explicit(&mem_pool_lock, 0, memory_order_release);
+}
 
-function result_t array_create(kind_t *kind) {
-  assert(kind->allocator != NULL);
+// Move up to count blocks of a class from the thread's cache to the pool.
+function void spill_mem_cache(u64 class, u64 count) {
+  mem_block_t *excess = NULL;
 
-  array_t *self = unwrap(array_t, alloc(kind, NULL, sizeof(array_t)));
+  lock_mem_pool();
 
-  // If the allocation fails, the try will crash the program.
+  while (count-- && mem_cache[class]) {
+    mem_block_t *block = mem_cache[class];
+    mem_cache[class] = block->next;
+    mem_cache_len[class]--;
 
-  self->kind = kind;
-  self->len = 0;
-  self->cap = 2;
+    block->next = mem_pool[class];
+    mem_pool[class] = block;
+    mem_pool_len[class]++;
+  }
 
-  self->data = unwrap(u8, self->kind->allocator(self->kind, NULL, self->cap));
+  // Take whatever the pool can't keep, and free it once the lock is gone.
+  while (mem_pool_len[class] > MEM_POOL_LIMIT) {
+    mem_block_t *block = mem_pool[class];
+    mem_pool[class] = block->next;
+    mem_pool_len[class]--;
 
-  return ok(self);
-}
+    block->next = excess;
+    excess = block;
+  }
 
-function result_t array_destroy(array_t *self) {
+  unlock_mem_pool();
 
-  alloc(self->kind, self->data, 0);
-  alloc(self->kind, self, 0);
+  while (excess) {
+    mem_block_t *block = excess;
+    excess = block->next;
 
-  return ok(NULL);
+    free(cast(u8, block) - MEM_HEADER);
+  }
 }
 
-function result_t array_emplace(array_t *self, void *data) {
-  if (self->len == self->cap) {
-    try(grow_array(self));
-  }
+// Move up to a batch of blocks of a class from the pool to the thread.
+function void refill_mem_cache(u64 class) {
+  lock_mem_pool();
 
-  u8 *new_item = self->data + self->kind->item_size * self->len++;
+  for (u64 i = 0; i < MEM_BATCH && mem_pool[class]; i++) {
+    mem_block_t *block = mem_pool[class];
+    mem_pool[class] = block->next;
+    mem_pool_len[class]--;
 
-  memcpy(new_item, data, self->kind->item_size);
+    block->next = mem_cache[class];
+    mem_cache[class] = block;
+    mem_cache_len[class]++;
+  }
 
-  return ok(new_item);
+  unlock_mem_pool();
 }
 
-function result_t array_append(array_t *self) {
-  if (self->len == self->cap) {
-    try(grow_array(self));
-  }
+function void *acquire_mem(u64 bytes) {
+  u64 class = mem_class(bytes);
 
-  u8 *new_item = self->data + self->kind->item_size * self->len++;
+  if (class == MEM_LARGE) {
+    u64 *header = malloc(MEM_HEADER + bytes);
 
-  return ok(new_item);
-}
+    if (header == NULL)
+      return NULL;
 
-function result_t array_pop(array_t *self) {
-  if (self->len == 0) {
-    return err(BOUNDS_ERR);
+    header[0] = MEM_LARGE;
+    header[1] = bytes;
+
+    return cast(u8, header) + MEM_HEADER;
   }
 
-  self->len--;
-  return ok(self->data + self->kind->item_size * self->len);
-}
+  if (!mem_cache[class])
+    refill_mem_cache(class);
 
-function result_t array_get(array_t *self, u64 offset) {
-  if (offset >= self->len) {
-    return err(BOUNDS_ERR);
+  if (mem_cache[class]) {
+    mem_block_t *block = mem_cache[class];
+    mem_cache[class] = block->next;
+    mem_cache_len[class]--;
+
+    return block;
   }
 
-  return ok(self->data + self->kind->item_size * offset);
-}
+  u64 *header = malloc(MEM_HEADER + mem_class_size(class));
 
-function result_t array_set(array_t *self, u64 offset, void *data) {
-  if (offset >= self->len) {
-    return err(BOUNDS_ERR);
-  }
+  if (header == NULL)
+    return NULL;
 
-  void *dest = memcpy(self->data + self->kind->item_size * offset, data,
-                      self->kind->item_size);
+  header[0] = class;
+  header[1] = mem_class_size(class);
 
-  return ok(dest);
+  return cast(u8, header) + MEM_HEADER;
 }
 
-function result_t array_view(array_t *self, u64 offset, u64 len) {
+function void release_mem(void *ptr) {
+  u64 class = mem_header(ptr)[0];
 
-  if (len + offset > self->len) {
-    return err(BOUNDS_ERR);
+  if (class == MEM_LARGE) {
+    free(mem_header(ptr));
+    return;
   }
 
-  view_t *view = unwrap(view_t, alloc(self->kind, NULL, sizeof(view_t)));
-
-  view->kind = self->kind;
-  view->data = self->data + self->kind->item_size * offset;
-  view->len = len;
+  mem_block_t *block = ptr;
+  block->next = mem_cache[class];
+  mem_cache[class] = block;
 
-  return ok(view);
+  if (++mem_cache_len[class] > MEM_CACHE_LIMIT)
+    spill_mem_cache(class, MEM_BATCH);
 }
 
-/* ------------ VIEWS ------------ */
+function result_t mem_cached(const kind_t *kind, void *ptr, u64 len) {
+  // The header only keeps malloc's alignment.
+  if (kind->alignment > MEM_HEADER)
+    return mem_default(kind, ptr, len);
 
-function result_t view_create(kind_t *kind, void *data, u64 len) {
+  if (len == 0) {
+    if (ptr)
+      release_mem(ptr);
+
+    return ok(NULL);
+  }
+
+  u64 bytes = kind->item_size * len;
+
+  if (ptr == NULL) {
+    void *result = acquire_mem(bytes);
+
+    if (result == NULL)
+      return err(MEMORY_ERR);
+
+    return ok(result);
+  }
+
+  u64 *header = mem_header(ptr);
+
+  // Growing within the block's class, or shrinking, keeps the block.
+  if (bytes <= header[1])
+    return ok(ptr);
+
+  // Large blocks already came from malloc, so let realloc move them.
+  if (header[0] == MEM_LARGE) {
+    header = realloc(header, MEM_HEADER + bytes);
+
+    if (header == NULL)
+      return err(MEMORY_ERR);
+
+    header[1] = bytes;
+
+    return ok(cast(u8, header) + MEM_HEADER);
+  }
+
+  // Containers grow by doubling, so move into a block with room for the
+  // next doubling too, and that one can stay in place. Once the doubled
+  // size outgrows the classes, the block is large and later grows realloc.
+  void *result = acquire_mem(bytes * 2);
+
+  if (result == NULL)
+    return err(MEMORY_ERR);
+
+  memcpy(result, ptr, header[1]);
+  release_mem(ptr);
+
+  return ok(result);
+}
+
+function void mem_cached_flush(void) {
+  for (u64 class = 0; class < MEM_CLASSES; class++) {
+    spill_mem_cache(class, mem_cache_len[class]);
+  }
+}
+
+#undef mem_pause
+#undef mem_header
+#undef mem_class_size
+
+function result_t grow_array(array_t *self) {
+
+  self->cap *= 2;
+
+  result_t result = alloc(self->kind, self->data, self->cap);
+
+  self->data = unwrap(u8, result);
+
+  return ok(NULL);
+}
+
+function result_t grow_dict(dict_t *self) {
+
+  // Save a ref to the old array of data.
+  u8 *old_data = self->data;
+  u64 old_cap = self->cap;
+
+  // Increase the capacity, reset the length, and reserve a new array.
+  self->cap *= 2;
+  self->len = 0;
+
+  result_t result = alloc(&self->internal_kind, NULL, self->cap);
+
+  self->data = unwrap(u8, result);
+
+  memset(self->data, 0, self->cap * self->internal_kind.item_size);
+
+  // The filter is sized for the capacity, so rebuild it alongside.
+  if (self->filter) {
+    try(bloom_destroy(self->filter));
+    self->filter = unwrap(bloom_t, bloom_create(self->key_kind, self->cap));
+  }
+
+  // For each kvp in the old array, insert it into the new dict.
+  for (u64 i = 0; i < old_cap; i++) {
+    u8 *bucket = old_data + i * self->internal_kind.item_size;
+    void *key = bucket;
+    void *val = bucket + self->val_offset;
+
+    if (bucket[self->used_offset]) {
+      dict_set(self, key, val);
+    }
+  }
+
+  try(alloc(&self->internal_kind, old_data, 0));
+
+  return ok(NULL);
+}
+
+/* ------------ arrayS ------------ */
+
+function result_t array_create(kind_t *kind) {
+  assert(kind->allocator != NULL);
+
+  array_t *self = unwrap(array_t, alloc_bytes(kind, NULL, sizeof(array_t)));
+
+  // If the allocation fails, the try will crash the program.
+
+  self->kind = kind;
+  self->len = 0;
+  self->cap = 2;
+
+  self->data = unwrap(u8, self->kind->allocator(self->kind, NULL, self->cap));
+
+  return ok(self);
+}
+
+function result_t array_destroy(array_t *self) {
+
+  alloc(self->kind, self->data, 0);
+  alloc(self->kind, self, 0);
+
+  return ok(NULL);
+}
+
+function result_t array_emplace(array_t *self, void *data) {
+  if (self->len == self->cap) {
+    try(grow_array(self));
+  }
+
+  u8 *new_item = self->data + self->kind->item_size * self->len++;
+
+  memcpy(new_item, data, self->kind->item_size);
+
+  return ok(new_item);
+}
+
+function result_t array_append(array_t *self) {
+  if (self->len == self->cap) {
+    try(grow_array(self));
+  }
+
+  u8 *new_item = self->data + self->kind->item_size * self->len++;
+
+  return ok(new_item);
+}
+
+function result_t array_pop(array_t *self) {
+  if (self->len == 0) {
+    return err(BOUNDS_ERR);
+  }
+
+  self->len--;
+  return ok(self->data + self->kind->item_size * self->len);
+}
+
+function result_t array_get(array_t *self, u64 offset) {
+  if (offset >= self->len) {
+    return err(BOUNDS_ERR);
+  }
+
+  return ok(self->data + self->kind->item_size * offset);
+}
+
+function result_t array_set(array_t *self, u64 offset, void *data) {
+  if (offset >= self->len) {
+    return err(BOUNDS_ERR);
+  }
+
+  void *dest = memcpy(self->data + self->kind->item_size * offset, data,
+                      self->kind->item_size);
+
+  return ok(dest);
+}
+
+function result_t array_view(array_t *self, u64 offset, u64 len) {
+
+  if (len + offset > self->len) {
+    return err(BOUNDS_ERR);
+  }
+
+  view_t *view = unwrap(view_t, alloc_bytes(self->kind, NULL, sizeof(view_t)));
+
+  view->kind = self->kind;
+  view->data = self->data + self->kind->item_size * offset;
+  view->len = len;
+
+  return ok(view);
+}
+
+/* ------------ VIEWS ------------ */
+
+function result_t view_create(kind_t *kind, void *data, u64 len) {
   assert(kind->allocator != NULL);
 
-  view_t *self = unwrap(view_t, alloc(kind, NULL, sizeof(view_t)));
+  view_t *self = unwrap(view_t, alloc_bytes(kind, NULL, sizeof(view_t)));
 
   self->kind = kind;
   self->data = (u8 *)data;
@@ -528,134 +1197,1783 @@ function result_t view_get(view_t *self, u64 offset) {
   return ok(self->data + self->kind->item_size * offset);
 };
 
-/* ------------ SLICES ------------ */
+function const u8 *find_byte(const u8 *data, u64 len, u8 byte) {
+  u64 i = 0;
 
-function result_t slice_create(kind_t *kind, const u8 *data, u64 len) {
+#if defined(__AVX2__)
+  __m256i wide = _mm256_set1_epi8((char)byte);
 
-  result_t res =
-      kind->allocator(kind, NULL, sizeof(array_t) + (len * kind->item_size));
+  for (; i + 32 <= len; i += 32) {
+    __m256i chunk = _mm256_loadu_si256((const __m256i *)(data + i));
+    u32 mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, wide));
 
-  array_t *self = unwrap(array_t, res);
+    if (mask)
+      return data + i + __builtin_ctz(mask);
+  }
+#endif
 
-  self->kind = kind;
-  self->len = len;
+#if defined(__SSE2__)
+  __m128i narrow = _mm_set1_epi8((char)byte);
 
-  copy(kind, self->data, data, len);
+  for (; i + 16 <= len; i += 16) {
+    __m128i chunk = _mm_loadu_si128((const __m128i *)(data + i));
+    u32 mask = _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, narrow));
 
-  return ok(self);
-}
+    if (mask)
+      return data + i + __builtin_ctz(mask);
+  }
+#endif
 
-function result_t slice_destroy(slice_t *self) {
-  try(alloc(self->kind, self, 0));
+  for (; i < len; i++) {
+    if (data[i] == byte)
+      return data + i;
+  }
 
-  return ok(NULL);
+  return NULL;
 }
 
-function result_t slice_get(slice_t *self, u64 offset) {
-  if (offset >= self->len) {
-    return err(BOUNDS_ERR);
-  }
+function const u8 *find_any(const u8 *data, u64 len, const u8 *set, u64 n) {
+  u64 i = 0;
 
-  return ok(self->data + self->kind->item_size * offset);
-}
+  if (n > VIEW_ANY_MAX) {
+    u8 table[256] = {0};
 
-/* ------------ DICTIONARIES------------ */
-function result_t dict_create(kind_t *val_kind, kind_t *key_kind) {
+    for (u64 j = 0; j < n; j++) {
+      table[set[j]] = true;
+    }
 
-  kind_t internal_kind = {
-      .item_size = val_kind->item_size + key_kind->item_size + 1,
-      .allocator = key_kind->allocator,
-      .user_name = "__internal_kind__",
-  };
+    for (; i < len; i++) {
+      if (table[data[i]])
+        return data + i;
+    }
 
-  dict_t *self = unwrap(dict_t, alloc(&internal_kind, NULL, sizeof(dict_t)));
+    return NULL;
+  }
 
-  self->internal_kind = internal_kind;
-  self->key_kind = key_kind;
-  self->val_kind = val_kind;
-  self->len = 0;
-  self->cap = 8;
+#if defined(__AVX2__)
+  // Broadcast each delimiter once, not once per chunk.
+  __m256i wide[VIEW_ANY_MAX];
 
-  self->data = unwrap(u8, alloc(&self->internal_kind, NULL, self->cap));
+  for (u64 j = 0; j < n; j++) {
+    wide[j] = _mm256_set1_epi8((char)set[j]);
+  }
 
-  return ok(self);
-};
+  for (; i + 32 <= len; i += 32) {
+    __m256i chunk = _mm256_loadu_si256((const __m256i *)(data + i));
+    __m256i hits = _mm256_setzero_si256();
 
-function boolean dict_has_key(dict_t *self, void *key) {
-  u64 index = hash(self->key_kind, key) % self->cap;
-  return *(self->data + self->internal_kind.item_size * index);
-};
+    for (u64 j = 0; j < n; j++) {
+      hits = _mm256_or_si256(hits, _mm256_cmpeq_epi8(chunk, wide[j]));
+    }
 
-function result_t dict_destroy(dict_t *self) {
-  self->internal_kind.allocator(&self->internal_kind, self->data, 0);
-  free(self);
-  return ok(NULL);
-}
+    u32 mask = _mm256_movemask_epi8(hits);
 
-function result_t dict_set(dict_t *self, void *key, void *val) {
+    if (mask)
+      return data + i + __builtin_ctz(mask);
+  }
+#endif
 
-  if (self->len > self->cap * DICT_LOAD) {
-    grow_dict(self);
+#if defined(__SSE2__)
+  __m128i narrow[VIEW_ANY_MAX];
+
+  for (u64 j = 0; j < n; j++) {
+    narrow[j] = _mm_set1_epi8((char)set[j]);
   }
 
-  size_t index = hash(self->key_kind, key) % self->cap;
-  u8 *bucket = self->data + self->internal_kind.item_size * index;
+  for (; i + 16 <= len; i += 16) {
+    __m128i chunk = _mm_loadu_si128((const __m128i *)(data + i));
+    __m128i hits = _mm_setzero_si128();
 
-  if (bucket[0]) {
-    // Chain through until a key matches
-    while (memcmp(key, bucket + 1, self->key_kind->item_size) != 0) {
-      // If the key doesnt exist
-      if (!bucket[0]) {
-        // Insert a new kvp
-        break;
-      }
-      // Check next bucket
-      bucket = self->data + self->internal_kind.item_size * ++index;
+    for (u64 j = 0; j < n; j++) {
+      hits = _mm_or_si128(hits, _mm_cmpeq_epi8(chunk, narrow[j]));
+    }
 
-      if (bucket >= self->data + self->internal_kind.item_size * self->cap) {
-        return err(WRAP_ERR);
-      }
+    u32 mask = _mm_movemask_epi8(hits);
+
+    if (mask)
+      return data + i + __builtin_ctz(mask);
+  }
+#endif
+
+  for (; i < len; i++) {
+    for (u64 j = 0; j < n; j++) {
+      if (data[i] == set[j])
+        return data + i;
     }
   }
 
-  // insert new key and value.
-  self->len++;
+  return NULL;
+}
 
-  // The bucket's key has been seen.
-  bucket[0] = true;
+function result_t view_find_byte(view_t *self, u8 byte) {
+  check(self->kind->item_size == 1, "View should have a kind with size 1");
 
-  memcpy(bucket + 1, key, self->key_kind->item_size);
+  return ok((void *)find_byte(self->data, self->len, byte));
+}
 
-  memcpy(bucket + 1 + self->key_kind->item_size, val,
-         self->val_kind->item_size);
+function result_t view_find_any(view_t *self, const u8 *set, u64 n) {
+  check(self->kind->item_size == 1, "View should have a kind with size 1");
 
-  // Return a pointer to the set value.
-  return ok(bucket + 1 + self->key_kind->item_size);
+  return ok((void *)find_any(self->data, self->len, set, n));
 }
 
-function result_t dict_get(dict_t *self, void *key) {
-  size_t index = hash(self->key_kind, key) % self->cap;
-  u8 *bucket = self->data + self->internal_kind.item_size * index;
+function u64 view_count_byte(view_t *self, u8 byte) {
+  check(self->kind->item_size == 1, "View should have a kind with size 1");
 
-  boolean has_key = *(self->data + self->internal_kind.item_size * index);
+  const u8 *data = self->data;
+  u64 len = self->len;
+  u64 count = 0;
+  u64 i = 0;
 
-  if (!has_key) {
-    // The key does not exist
-    return ok(NULL);
+#if defined(__AVX2__)
+  __m256i wide = _mm256_set1_epi8((char)byte);
+
+  for (; i + 32 <= len; i += 32) {
+    __m256i chunk = _mm256_loadu_si256((const __m256i *)(data + i));
+    u32 mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, wide));
+    count += __builtin_popcount(mask);
   }
+#endif
 
-  // memcmp the given key and the key we have to make sure its a match
-  while (memcmp(bucket + 1, key, self->key_kind->item_size) != 0) {
-    // return a pointer into the bucket at the value's position.
-    if (bucket >= self->data + self->internal_kind.item_size * self->cap) {
-      return err(WRAP_ERR);
-    }
+#if defined(__SSE2__)
+  __m128i narrow = _mm_set1_epi8((char)byte);
+
+  for (; i + 16 <= len; i += 16) {
+    __m128i chunk = _mm_loadu_si128((const __m128i *)(data + i));
+    u32 mask = _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, narrow));
+    count += __builtin_popcount(mask);
+  }
+#endif
 
-    // Chain the buckets
-    bucket = self->data + self->internal_kind.item_size * ++index;
+  for (; i < len; i++) {
+    count += data[i] == byte;
   }
 
-  return ok(bucket + self->key_kind->item_size + 1);
+  return count;
+}
+
+function boolean view_equals(view_t *self, view_t *other) {
+  if (self->len != other->len || size(self) != size(other))
+    return false;
+
+  return memcmp(self->data, other->data, self->len * size(self)) == 0;
+}
+
+function boolean view_starts_with(view_t *self, view_t *prefix) {
+  if (self->len < prefix->len || size(self) != size(prefix))
+    return false;
+
+  return memcmp(self->data, prefix->data, prefix->len * size(self)) == 0;
+}
+
+/* ------------ SPLITS ------------ */
+
+function split_t view_split(view_t *view, u8 delim) {
+  check(view->kind->item_size == 1, "View should have a kind with size 1");
+
+  return (split_t){.rest = *view, .delim = delim, .done = false};
+}
+
+function boolean split_next(split_t *self, view_t *piece) {
+  if (self->done)
+    return false;
+
+  const u8 *found = find_byte(self->rest.data, self->rest.len, self->delim);
+
+  *piece = self->rest;
+
+  if (found == NULL) {
+    // The remainder is the last piece.
+    self->done = true;
+    return true;
+  }
+
+  piece->len = found - self->rest.data;
+
+  self->rest.data += piece->len + 1;
+  self->rest.len -= piece->len + 1;
+
+  return true;
+}
+
+/* ------------ SLICES ------------ */
+
+function result_t slice_create(kind_t *kind, const u8 *data, u64 len) {
+
+  result_t res =
+      kind->allocator(kind, NULL, sizeof(array_t) + (len * kind->item_size));
+
+  array_t *self = unwrap(array_t, res);
+
+  self->kind = kind;
+  self->len = len;
+
+  copy(kind, self->data, data, len);
+
+  return ok(self);
+}
+
+function result_t slice_destroy(slice_t *self) {
+  try(alloc(self->kind, self, 0));
+
+  return ok(NULL);
+}
+
+function result_t slice_get(slice_t *self, u64 offset) {
+  if (offset >= self->len) {
+    return err(BOUNDS_ERR);
+  }
+
+  return ok(self->data + self->kind->item_size * offset);
+}
+
+/* ------------ FILTERS ------------ */
+
+// Spread the bits of a hash, since kind hashers are often the identity.
+function u64 mix_hash(u64 h) {
+  h ^= h >> 30;
+  h *= 0xbf58476d1ce4e5b9;
+  h ^= h >> 27;
+  h *= 0x94d049bb133111eb;
+  h ^= h >> 31;
+  return h;
+}
+
+function result_t bloom_create(kind_t *key_kind, u64 cap) {
+  assert(key_kind->hasher != NULL);
+
+  kind_t block_kind = {
+      .item_size = BLOOM_BLOCK_SIZE,
+      .alignment = BLOOM_BLOCK_SIZE,
+      .allocator = key_kind->allocator,
+      .user_name = "__internal_kind__",
+  };
+
+  bloom_t *self =
+      unwrap(bloom_t, alloc_bytes(&block_kind, NULL, sizeof(bloom_t)));
+
+  self->block_kind = block_kind;
+  self->key_kind = key_kind;
+  self->blocks = (cap * BLOOM_BITS_PER_KEY + BLOOM_BLOCK_SIZE * 8 - 1) /
+                 (BLOOM_BLOCK_SIZE * 8);
+
+  if (self->blocks == 0)
+    self->blocks = 1;
+
+  self->data = unwrap(u8, alloc(&self->block_kind, NULL, self->blocks));
+
+  memset(self->data, 0, self->blocks * BLOOM_BLOCK_SIZE);
+
+  return ok(self);
+}
+
+function result_t bloom_destroy(bloom_t *self) {
+  alloc(&self->block_kind, self->data, 0);
+  alloc(&self->block_kind, self, 0);
+
+  return ok(NULL);
+}
+
+// The upper half of the hash picks a block, the lower half sets one bit in
+// each of the block's eight words.
+#define bloom_block(self, h)                                                   \
+  cast(u64, (self->data + ((h >> 32) * self->blocks >> 32) * BLOOM_BLOCK_SIZE))
+
+function result_t bloom_add(bloom_t *self, void *key) {
+  u64 h = mix_hash(hash(self->key_kind, key));
+  u64 *block = bloom_block(self, h);
+
+  for (u64 i = 0; i < BLOOM_BLOCK_SIZE / sizeof(u64); i++) {
+    block[i] |= (u64)1 << ((h >> (i * 6)) & 63);
+  }
+
+  return ok(NULL);
+}
+
+// Batched lookups split bloom_has in two, fetching a key's block by its mixed
+// hash well before testing it.
+function void bloom_prefetch(bloom_t *self, u64 h) {
+  __builtin_prefetch(bloom_block(self, h), 0);
+}
+
+function boolean bloom_test(bloom_t *self, u64 h) {
+  u64 *block = bloom_block(self, h);
+
+  for (u64 i = 0; i < BLOOM_BLOCK_SIZE / sizeof(u64); i++) {
+    if (!(block[i] & (u64)1 << ((h >> (i * 6)) & 63)))
+      return false;
+  }
+
+  return true;
+}
+
+function boolean bloom_has(bloom_t *self, void *key) {
+  return bloom_test(self, mix_hash(hash(self->key_kind, key)));
+}
+
+#undef bloom_block
+
+function result_t cuckoo_create(kind_t *key_kind, u64 cap) {
+  assert(key_kind->hasher != NULL);
+
+  kind_t bucket_kind = {
+      .item_size = CUCKOO_BUCKET_SIZE * sizeof(u16),
+      .allocator = key_kind->allocator,
+      .user_name = "__internal_kind__",
+  };
+
+  cuckoo_t *self =
+      unwrap(cuckoo_t, alloc_bytes(&bucket_kind, NULL, sizeof(cuckoo_t)));
+
+  // Use a power of two bucket count, filled to at most 90%.
+  u64 buckets = 1;
+  while (buckets * CUCKOO_BUCKET_SIZE * 9 < cap * 10) {
+    buckets <<= 1;
+  }
+
+  self->bucket_kind = bucket_kind;
+  self->key_kind = key_kind;
+  self->mask = buckets - 1;
+  self->len = 0;
+  self->victim = 0;
+  self->victim_index = 0;
+
+  self->data = unwrap(u16, alloc(&self->bucket_kind, NULL, buckets));
+
+  memset(self->data, 0, buckets * self->bucket_kind.item_size);
+
+  return ok(self);
+}
+
+function result_t cuckoo_destroy(cuckoo_t *self) {
+  alloc(&self->bucket_kind, self->data, 0);
+  alloc(&self->bucket_kind, self, 0);
+
+  return ok(NULL);
+}
+
+// Fingerprints are never zero, zero marks an empty slot.
+#define cuckoo_fingerprint(h) ((u16)((h) >> 48) ? (u16)((h) >> 48) : 1)
+
+#define cuckoo_alternate(self, index, fp)                                      \
+  (((index) ^ mix_hash(fp)) & (self)->mask)
+
+function boolean cuckoo_bucket_has(cuckoo_t *self, u64 index, u16 fp) {
+  u16 *bucket = self->data + index * CUCKOO_BUCKET_SIZE;
+
+  for (u64 i = 0; i < CUCKOO_BUCKET_SIZE; i++) {
+    if (bucket[i] == fp)
+      return true;
+  }
+
+  return false;
+}
+
+function boolean cuckoo_bucket_put(cuckoo_t *self, u64 index, u16 fp) {
+  u16 *bucket = self->data + index * CUCKOO_BUCKET_SIZE;
+
+  for (u64 i = 0; i < CUCKOO_BUCKET_SIZE; i++) {
+    if (!bucket[i]) {
+      bucket[i] = fp;
+      return true;
+    }
+  }
+
+  return false;
+}
+
+function result_t cuckoo_add(cuckoo_t *self, void *key) {
+  if (self->victim) {
+    return err(MEMORY_ERR);
+  }
+
+  u64 h = mix_hash(hash(self->key_kind, key));
+  u16 fp = cuckoo_fingerprint(h);
+  u64 index = h & self->mask;
+
+  self->len++;
+
+  if (cuckoo_bucket_put(self, index, fp) ||
+      cuckoo_bucket_put(self, cuckoo_alternate(self, index, fp), fp))
+    return ok(NULL);
+
+  // Both buckets are full, so evict fingerprints until one finds a home.
+  for (u64 kick = 0; kick < CUCKOO_MAX_KICKS; kick++) {
+    u16 *slot = self->data + index * CUCKOO_BUCKET_SIZE +
+                (h >> (kick % 31 * 2) & (CUCKOO_BUCKET_SIZE - 1));
+
+    u16 evicted = *slot;
+    *slot = fp;
+    fp = evicted;
+
+    index = cuckoo_alternate(self, index, fp);
+
+    if (cuckoo_bucket_put(self, index, fp))
+      return ok(NULL);
+  }
+
+  // Keep the homeless fingerprint around, so it is not lost.
+  self->victim = fp;
+  self->victim_index = index;
+
+  return ok(NULL);
+}
+
+function boolean cuckoo_has(cuckoo_t *self, void *key) {
+  u64 h = mix_hash(hash(self->key_kind, key));
+  u16 fp = cuckoo_fingerprint(h);
+  u64 index = h & self->mask;
+  u64 other = cuckoo_alternate(self, index, fp);
+
+  if (self->victim == fp &&
+      (self->victim_index == index || self->victim_index == other))
+    return true;
+
+  return cuckoo_bucket_has(self, index, fp) ||
+         cuckoo_bucket_has(self, other, fp);
+}
+
+function boolean cuckoo_remove(cuckoo_t *self, void *key) {
+  u64 h = mix_hash(hash(self->key_kind, key));
+  u16 fp = cuckoo_fingerprint(h);
+  u64 index = h & self->mask;
+  u64 indices[2] = {index, cuckoo_alternate(self, index, fp)};
+
+  for (u64 i = 0; i < 2; i++) {
+    u16 *bucket = self->data + indices[i] * CUCKOO_BUCKET_SIZE;
+
+    for (u64 j = 0; j < CUCKOO_BUCKET_SIZE; j++) {
+      if (bucket[j] == fp) {
+        bucket[j] = 0;
+        self->len--;
+
+        // Now that there is room, try to place the victim again.
+        if (self->victim) {
+          u16 victim = self->victim;
+          u64 home = self->victim_index;
+          self->victim = 0;
+
+          if (!cuckoo_bucket_put(self, home, victim) &&
+              !cuckoo_bucket_put(self, cuckoo_alternate(self, home, victim),
+                                 victim)) {
+            self->victim = victim;
+          }
+        }
+
+        return true;
+      }
+    }
+  }
+
+  if (self->victim == fp && (self->victim_index == indices[0] ||
+                             self->victim_index == indices[1])) {
+    self->victim = 0;
+    self->len--;
+    return true;
+  }
+
+  return false;
+}
+
+#undef cuckoo_fingerprint
+#undef cuckoo_alternate
+
+/* ------------ DICTIONARIES------------ */
+// The kind of a key, value and used flag stored together, each aligned.
+function kind_t pair_kind(kind_t *key_kind, kind_t *val_kind, u64 *val_offset,
+                          u64 *used_offset) {
+  u64 key_align = kind_align(key_kind);
+  u64 val_align = kind_align(val_kind);
+  u64 align = key_align > val_align ? key_align : val_align;
+
+  *val_offset = align_up(key_kind->item_size, val_align);
+  *used_offset = *val_offset + val_kind->item_size;
+
+  return (kind_t){
+      .item_size = align_up(*used_offset + 1, align),
+      .alignment = align,
+      .allocator = key_kind->allocator,
+      .user_name = "__internal_kind__",
+  };
+}
+
+function result_t dict_create(kind_t *val_kind, kind_t *key_kind) {
+
+  u64 val_offset, used_offset;
+
+  kind_t internal_kind =
+      pair_kind(key_kind, val_kind, &val_offset, &used_offset);
+
+  dict_t *self =
+      unwrap(dict_t, alloc_bytes(&internal_kind, NULL, sizeof(dict_t)));
+
+  self->internal_kind = internal_kind;
+  self->key_kind = key_kind;
+  self->val_kind = val_kind;
+  self->val_offset = val_offset;
+  self->used_offset = used_offset;
+  self->len = 0;
+  self->cap = 8;
+
+  self->filter = NULL;
+
+  self->data = unwrap(u8, alloc(&self->internal_kind, NULL, self->cap));
+
+  memset(self->data, 0, self->cap * self->internal_kind.item_size);
+
+  return ok(self);
+};
+
+function boolean dict_has_key(dict_t *self, void *key) {
+  if (self->filter && !bloom_has(self->filter, key))
+    return false;
+
+  u64 index = hash(self->key_kind, key) % self->cap;
+  return self->data[self->internal_kind.item_size * index + self->used_offset];
+};
+
+function result_t dict_destroy(dict_t *self) {
+  if (self->filter)
+    bloom_destroy(self->filter);
+
+  self->internal_kind.allocator(&self->internal_kind, self->data, 0);
+  alloc(&self->internal_kind, self, 0);
+  return ok(NULL);
+}
+
+// Set a key, chaining from the bucket at index.
+function result_t dict_set_at(dict_t *self, u64 index, void *key, void *val) {
+  u8 *bucket = self->data + self->internal_kind.item_size * index;
+
+  // Chain through until a key matches, or the key doesnt exist. The load
+  // factor keeps an empty bucket somewhere, so the chain can wrap around.
+  while (bucket[self->used_offset] &&
+         memcmp(key, bucket, self->key_kind->item_size) != 0) {
+    // Check next bucket
+    index = (index + 1) % self->cap;
+    bucket = self->data + self->internal_kind.item_size * index;
+  }
+
+  // insert new key and value.
+  if (!bucket[self->used_offset]) {
+    self->len++;
+
+    if (self->filter)
+      try(bloom_add(self->filter, key));
+  }
+
+  // The bucket's key has been seen.
+  bucket[self->used_offset] = true;
+
+  memcpy(bucket, key, self->key_kind->item_size);
+
+  memcpy(bucket + self->val_offset, val, self->val_kind->item_size);
+
+  // Return a pointer to the set value.
+  return ok(bucket + self->val_offset);
+}
+
+function result_t dict_set(dict_t *self, void *key, void *val) {
+
+  if (self->len > self->cap * DICT_LOAD) {
+    grow_dict(self);
+  }
+
+  return dict_set_at(self, hash(self->key_kind, key) % self->cap, key, val);
+}
+
+// Get a key's value, chaining from the bucket at index.
+function result_t dict_get_at(dict_t *self, u64 index, void *key) {
+  u8 *bucket = self->data + self->internal_kind.item_size * index;
+
+  // Chain through the buckets until the key matches or one is empty.
+  while (bucket[self->used_offset]) {
+    // memcmp the given key and the key we have to make sure its a match
+    if (memcmp(bucket, key, self->key_kind->item_size) == 0) {
+      // return a pointer into the bucket at the value's position.
+      return ok(bucket + self->val_offset);
+    }
+
+    // Chain the buckets, wrapping around the end.
+    index = (index + 1) % self->cap;
+    bucket = self->data + self->internal_kind.item_size * index;
+  }
+
+  // The key does not exist
+  return ok(NULL);
+}
+
+function result_t dict_get(dict_t *self, void *key) {
+  if (self->filter && !bloom_has(self->filter, key)) {
+    // The filter has never seen this key.
+    return ok(NULL);
+  }
+
+  return dict_get_at(self, hash(self->key_kind, key) % self->cap, key);
+}
+
+#define dict_prefetch(self, index, write)                                      \
+  __builtin_prefetch(                                                          \
+      (self)->data + (index) * (self)->internal_kind.item_size, write)
+
+function result_t dict_get_many(dict_t *self, view_t *keys, array_t *out) {
+  if (size(keys) != self->key_kind->item_size ||
+      size(out) != sizeof(void *)) {
+    return err(CAST_ERR);
+  }
+
+  while (out->cap < out->len + keys->len) {
+    try(grow_array(out));
+  }
+
+  u64 indices[DICT_BATCH];
+  u64 hashes[DICT_BATCH];
+
+  for (u64 start = 0; start < keys->len; start += DICT_BATCH) {
+    u64 count = keys->len - start;
+    count = count < DICT_BATCH ? count : DICT_BATCH;
+
+    // Hash the whole batch up front, prefetching each key's filter block.
+    for (u64 i = 0; i < count; i++) {
+      u64 h = hash(self->key_kind, keys->data + (start + i) * size(keys));
+      indices[i] = h % self->cap;
+
+      if (self->filter) {
+        hashes[i] = mix_hash(h);
+        bloom_prefetch(self->filter, hashes[i]);
+      }
+    }
+
+    // Test the filter and prefetch the bucket of key i, while resolving the
+    // probe DICT_PREFETCH keys behind it. Keys the filter rules out are
+    // marked, so they skip the prefetch and the probe.
+    for (u64 i = 0; i < count + DICT_PREFETCH; i++) {
+      if (i < count) {
+        if (self->filter && !bloom_test(self->filter, hashes[i]))
+          indices[i] = DICT_MISS;
+        else
+          dict_prefetch(self, indices[i], 0);
+      }
+
+      if (i < DICT_PREFETCH)
+        continue;
+
+      u64 j = i - DICT_PREFETCH;
+      void *val = NULL;
+
+      if (indices[j] != DICT_MISS) {
+        void *key = keys->data + (start + j) * size(keys);
+        result_t result = dict_get_at(self, indices[j], key);
+
+        if (result.status != OK)
+          return result;
+
+        val = result.data;
+      }
+
+      try(array_emplace(out, &val));
+    }
+  }
+
+  return ok(out);
+}
+
+function result_t dict_set_many(dict_t *self, view_t *keys, view_t *vals) {
+  if (size(keys) != self->key_kind->item_size ||
+      size(vals) != self->val_kind->item_size) {
+    return err(CAST_ERR);
+  }
+
+  if (keys->len != vals->len) {
+    return err(BOUNDS_ERR);
+  }
+
+  // Grow before hashing, so the batch's indices stay valid throughout.
+  while (self->len + keys->len > self->cap * DICT_LOAD) {
+    try(grow_dict(self));
+  }
+
+  u64 indices[DICT_BATCH];
+
+  for (u64 start = 0; start < keys->len; start += DICT_BATCH) {
+    u64 count = keys->len - start;
+    count = count < DICT_BATCH ? count : DICT_BATCH;
+
+    for (u64 i = 0; i < count; i++) {
+      indices[i] =
+          hash(self->key_kind, keys->data + (start + i) * size(keys)) %
+          self->cap;
+    }
+
+    for (u64 i = 0; i < count && i < DICT_PREFETCH; i++) {
+      dict_prefetch(self, indices[i], 1);
+    }
+
+    for (u64 i = 0; i < count; i++) {
+      if (i + DICT_PREFETCH < count)
+        dict_prefetch(self, indices[i + DICT_PREFETCH], 1);
+
+      result_t result =
+          dict_set_at(self, indices[i], keys->data + (start + i) * size(keys),
+                      vals->data + (start + i) * size(vals));
+
+      if (result.status != OK)
+        return result;
+    }
+  }
+
+  return ok(NULL);
+}
+
+#undef dict_prefetch
+
+function result_t dict_filter(dict_t *self) {
+  if (self->filter) {
+    return ok(self->filter);
+  }
+
+  self->filter = unwrap(bloom_t, bloom_create(self->key_kind, self->cap));
+
+  dict_each_as(self, key, val, {
+    (void)val;
+    try(bloom_add(self->filter, key));
+  });
+
+  return ok(self->filter);
+}
+
+/* ------------ COMPACT DICTIONARIES ------------ */
+
+#define CDICT_EMPTY 0
+
+#define CDICT_REMOVED 1
+
+#define CDICT_NONE UINT64_MAX
+
+function u64 cdict_slot(cdict_t *self, u64 i) {
+  switch (self->width) {
+  case 1:
+    return self->index[i];
+  case 2:
+    return cast(u16, self->index)[i];
+  case 4:
+    return cast(u32, self->index)[i];
+  default:
+    return cast(u64, self->index)[i];
+  }
+}
+
+function void cdict_put_slot(cdict_t *self, u64 i, u64 slot) {
+  switch (self->width) {
+  case 1:
+    self->index[i] = slot;
+    break;
+  case 2:
+    cast(u16, self->index)[i] = slot;
+    break;
+  case 4:
+    cast(u32, self->index)[i] = slot;
+    break;
+  default:
+    cast(u64, self->index)[i] = slot;
+  }
+}
+
+#define cdict_entry(self, slot)                                                \
+  ((self)->entries->data + ((slot)-2) * (self)->entry_kind.item_size)
+
+// Find the index position holding the key, and write it to insert too. If
+// it is missing, return CDICT_NONE and write the position a new entry
+// should go into.
+function u64 cdict_probe(cdict_t *self, void *key, u64 *insert) {
+  u64 mask = self->cap - 1;
+  u64 i = mix_hash(hash(self->key_kind, key)) & mask;
+  u64 removed = CDICT_NONE;
+
+  loop {
+    u64 slot = cdict_slot(self, i);
+
+    if (slot == CDICT_EMPTY)
+      break;
+
+    if (slot == CDICT_REMOVED) {
+      if (removed == CDICT_NONE)
+        removed = i;
+    } else if (memcmp(cdict_entry(self, slot), key,
+                      self->key_kind->item_size) == 0) {
+      if (insert)
+        *insert = i;
+
+      return i;
+    }
+
+    i = (i + 1) & mask;
+  }
+
+  if (insert)
+    *insert = removed == CDICT_NONE ? i : removed;
+
+  return CDICT_NONE;
+}
+
+// Drop removed entries and rebuild the index, growing it if needed. The
+// entries themselves only move to close gaps.
+function result_t rebuild_cdict(cdict_t *self) {
+  array_t *entries = self->entries;
+  u64 width = self->entry_kind.item_size;
+  u64 live = 0;
+
+  for (u64 i = 0; i < entries->len; i++) {
+    u8 *entry = entries->data + i * width;
+
+    if (entry[self->used_offset]) {
+      if (live != i)
+        memmove(entries->data + live * width, entry, width);
+
+      live++;
+    }
+  }
+
+  entries->len = live;
+
+  while (live + 1 > self->cap * DICT_LOAD) {
+    self->cap *= 2;
+  }
+
+  // The index only has to count as high as the entries, plus two.
+  if (self->cap <= UINT8_MAX)
+    self->width = sizeof(u8);
+  else if (self->cap <= UINT16_MAX)
+    self->width = sizeof(u16);
+  else if (self->cap <= UINT32_MAX)
+    self->width = sizeof(u32);
+  else
+    self->width = sizeof(u64);
+
+  self->index = unwrap(
+      u8, alloc(&self->index_kind, self->index, self->cap * self->width));
+
+  memset(self->index, 0, self->cap * self->width);
+
+  for (u64 i = 0; i < live; i++) {
+    u64 insert;
+    cdict_probe(self, entries->data + i * width, &insert);
+    cdict_put_slot(self, insert, i + 2);
+  }
+
+  return ok(NULL);
+}
+
+function result_t cdict_create(kind_t *val_kind, kind_t *key_kind) {
+  assert(key_kind->hasher != NULL);
+
+  u64 val_offset, used_offset;
+
+  kind_t entry_kind = pair_kind(key_kind, val_kind, &val_offset, &used_offset);
+
+  cdict_t *self =
+      unwrap(cdict_t, alloc_bytes(&entry_kind, NULL, sizeof(cdict_t)));
+
+  self->entry_kind = entry_kind;
+  self->key_kind = key_kind;
+  self->val_kind = val_kind;
+  self->val_offset = val_offset;
+  self->used_offset = used_offset;
+  self->len = 0;
+
+  self->index_kind = (kind_t){
+      .item_size = 1,
+      .allocator = key_kind->allocator,
+      .user_name = "__internal_kind__",
+  };
+
+  self->entries = unwrap(array_t, array_create(&self->entry_kind));
+  self->index = NULL;
+  self->cap = 8;
+
+  try(rebuild_cdict(self));
+
+  return ok(self);
+}
+
+function result_t cdict_destroy(cdict_t *self) {
+  array_destroy(self->entries);
+  alloc(&self->index_kind, self->index, 0);
+  alloc(&self->entry_kind, self, 0);
+
+  return ok(NULL);
+}
+
+function boolean cdict_has_key(cdict_t *self, void *key) {
+  return cdict_probe(self, key, NULL) != CDICT_NONE;
+}
+
+function result_t cdict_get(cdict_t *self, void *key) {
+  u64 i = cdict_probe(self, key, NULL);
+
+  if (i == CDICT_NONE) {
+    // The key does not exist
+    return ok(NULL);
+  }
+
+  return ok(cdict_entry(self, cdict_slot(self, i)) + self->val_offset);
+}
+
+function result_t cdict_set(cdict_t *self, void *key, void *val) {
+  u64 insert;
+  u64 i = cdict_probe(self, key, &insert);
+
+  if (i != CDICT_NONE) {
+    u8 *entry = cdict_entry(self, cdict_slot(self, i));
+    memcpy(entry + self->val_offset, val, self->val_kind->item_size);
+
+    return ok(entry + self->val_offset);
+  }
+
+  // Removed entries count too, they hold on to their index slots.
+  if (self->entries->len + 1 > self->cap * DICT_LOAD) {
+    try(rebuild_cdict(self));
+    cdict_probe(self, key, &insert);
+  }
+
+  u8 *entry = unwrap(u8, array_append(self->entries));
+
+  memcpy(entry, key, self->key_kind->item_size);
+  memcpy(entry + self->val_offset, val, self->val_kind->item_size);
+  entry[self->used_offset] = true;
+
+  cdict_put_slot(self, insert, self->entries->len + 1);
+  self->len++;
+
+  return ok(entry + self->val_offset);
+}
+
+function result_t cdict_remove(cdict_t *self, void *key) {
+  u64 i = cdict_probe(self, key, NULL);
+
+  if (i == CDICT_NONE) {
+    return err(BOUNDS_ERR);
+  }
+
+  cdict_entry(self, cdict_slot(self, i))[self->used_offset] = false;
+  cdict_put_slot(self, i, CDICT_REMOVED);
+  self->len--;
+
+  return ok(NULL);
+}
+
+#undef cdict_entry
+#undef CDICT_NONE
+#undef CDICT_REMOVED
+#undef CDICT_EMPTY
+
+/* ------------ SETS ------------ */
+
+#define set_bucket(self, i)                                                    \
+  ((self)->data + (i) * (self)->internal_kind.item_size)
+
+#define set_used(self, i) (set_bucket(self, i)[(self)->kind->item_size])
+
+#define set_home(self, key)                                                    \
+  (mix_hash(hash((self)->kind, key)) & ((self)->cap - 1))
+
+#define SET_NONE UINT64_MAX
+
+// Create a set with room for len keys before it has to grow.
+function result_t reserve_set(kind_t *kind, u64 len) {
+  assert(kind->hasher != NULL);
+
+  kind_t internal_kind = {
+      .item_size = align_up(kind->item_size + 1, kind_align(kind)),
+      .alignment = kind_align(kind),
+      .allocator = kind->allocator,
+      .user_name = "__internal_kind__",
+  };
+
+  set_t *self = unwrap(set_t, alloc_bytes(&internal_kind, NULL, sizeof(set_t)));
+
+  self->internal_kind = internal_kind;
+  self->kind = kind;
+  self->len = 0;
+  self->cap = 8;
+
+  while (len + 1 > self->cap * DICT_LOAD) {
+    self->cap *= 2;
+  }
+
+  self->data = unwrap(u8, alloc(&self->internal_kind, NULL, self->cap));
+
+  memset(self->data, 0, self->cap * self->internal_kind.item_size);
+
+  return ok(self);
+}
+
+// Find the bucket holding the key, and write it to insert too. If it is
+// missing, return SET_NONE and write the empty bucket it would go into.
+function u64 set_probe(set_t *self, void *key, u64 *insert) {
+  u64 i = set_home(self, key);
+
+  while (set_used(self, i)) {
+    if (memcmp(set_bucket(self, i), key, self->kind->item_size) == 0) {
+      if (insert)
+        *insert = i;
+
+      return i;
+    }
+
+    i = (i + 1) & (self->cap - 1);
+  }
+
+  if (insert)
+    *insert = i;
+
+  return SET_NONE;
+}
+
+// Rehash into a table with the given capacity, a power of two.
+function result_t resize_set(set_t *self, u64 cap) {
+  u8 *old_data = self->data;
+  u64 old_cap = self->cap;
+
+  self->cap = cap;
+
+  self->data = unwrap(u8, alloc(&self->internal_kind, NULL, self->cap));
+
+  memset(self->data, 0, self->cap * self->internal_kind.item_size);
+
+  for (u64 i = 0; i < old_cap; i++) {
+    u8 *bucket = old_data + i * self->internal_kind.item_size;
+
+    if (bucket[self->kind->item_size]) {
+      u64 insert;
+      set_probe(self, bucket, &insert);
+      memcpy(set_bucket(self, insert), bucket, self->internal_kind.item_size);
+    }
+  }
+
+  try(alloc(&self->internal_kind, old_data, 0));
+
+  return ok(NULL);
+}
+
+function result_t grow_set(set_t *self) {
+  return resize_set(self, self->cap * 2);
+}
+
+function result_t set_create(kind_t *kind) { return reserve_set(kind, 0); }
+
+function result_t set_destroy(set_t *self) {
+  alloc(&self->internal_kind, self->data, 0);
+  alloc(&self->internal_kind, self, 0);
+
+  return ok(NULL);
+}
+
+function result_t set_insert(set_t *self, void *key) {
+  u64 insert;
+  u64 i = set_probe(self, key, &insert);
+
+  if (i != SET_NONE) {
+    return ok(set_bucket(self, i));
+  }
+
+  if (self->len + 1 > self->cap * DICT_LOAD) {
+    try(grow_set(self));
+    set_probe(self, key, &insert);
+  }
+
+  memcpy(set_bucket(self, insert), key, self->kind->item_size);
+  set_used(self, insert) = true;
+  self->len++;
+
+  return ok(set_bucket(self, insert));
+}
+
+function result_t set_insert_view(set_t *self, view_t *view) {
+  if (size(view) != self->kind->item_size) {
+    return err(CAST_ERR);
+  }
+
+  // Find the capacity the whole view needs, and rehash just once.
+  u64 cap = self->cap;
+
+  while (self->len + view->len + 1 > cap * DICT_LOAD) {
+    cap *= 2;
+  }
+
+  if (cap != self->cap)
+    try(resize_set(self, cap));
+
+  view_each_as(view, key, try(set_insert(self, key)));
+
+  return ok(NULL);
+}
+
+function boolean set_contains(set_t *self, void *key) {
+  return set_probe(self, key, NULL) != SET_NONE;
+}
+
+function result_t set_remove(set_t *self, void *key) {
+  u64 i = set_probe(self, key, NULL);
+
+  if (i == SET_NONE) {
+    return err(BOUNDS_ERR);
+  }
+
+  u64 mask = self->cap - 1;
+
+  // Shift later keys of the run back, so probes never see a gap.
+  for (u64 j = (i + 1) & mask; set_used(self, j); j = (j + 1) & mask) {
+    u64 home = set_home(self, set_bucket(self, j));
+
+    if (((j - home) & mask) >= ((j - i) & mask)) {
+      memcpy(set_bucket(self, i), set_bucket(self, j),
+             self->internal_kind.item_size);
+      i = j;
+    }
+  }
+
+  set_used(self, i) = false;
+  self->len--;
+
+  return ok(NULL);
+}
+
+function result_t set_union(set_t *self, set_t *other) {
+  if (self->kind->item_size != other->kind->item_size) {
+    return err(CAST_ERR);
+  }
+
+  set_t *result =
+      unwrap(set_t, reserve_set(self->kind, self->len + other->len));
+
+  set_each_as(self, key, try(set_insert(result, key)));
+  set_each_as(other, key, try(set_insert(result, key)));
+
+  return ok(result);
+}
+
+function result_t set_intersection(set_t *self, set_t *other) {
+  if (self->kind->item_size != other->kind->item_size) {
+    return err(CAST_ERR);
+  }
+
+  // Walk the smaller set, and probe the larger one.
+  set_t *small = self->len < other->len ? self : other;
+  set_t *large = small == self ? other : self;
+
+  set_t *result = unwrap(set_t, reserve_set(self->kind, small->len));
+
+  set_each_as(small, key, {
+    if (set_contains(large, key))
+      try(set_insert(result, key));
+  });
+
+  return ok(result);
+}
+
+function result_t set_difference(set_t *self, set_t *other) {
+  if (self->kind->item_size != other->kind->item_size) {
+    return err(CAST_ERR);
+  }
+
+  set_t *result = unwrap(set_t, reserve_set(self->kind, self->len));
+
+  set_each_as(self, key, {
+    if (!set_contains(other, key))
+      try(set_insert(result, key));
+  });
+
+  return ok(result);
+}
+
+#undef SET_NONE
+#undef set_home
+#undef set_used
+#undef set_bucket
+
+/* ------------ PACKED INTEGERS ------------ */
+
+#define pack_mask(width) ((width) == 64 ? UINT64_MAX : ((u64)1 << (width)) - 1)
+
+// The bytes a bit packed block of the given width takes up.
+#define pack_bits_size(width)                                                  \
+  (PACK_LANES * ((PACK_BLOCK / PACK_LANES * (width) + 63) / 64) * sizeof(u64))
+
+#define pack_zigzag(delta) (((delta) << 1) ^ (u64)((i64)(delta) >> 63))
+
+#define pack_unzigzag(zz) (((zz) >> 1) ^ -((zz)&1))
+
+function u64 pack_varint_size(u64 value) {
+  u64 bytes = 1;
+
+  while (value >= 0x80) {
+    value >>= 7;
+    bytes++;
+  }
+
+  return bytes;
+}
+
+function u8 *pack_varint(u8 *dest, u64 value) {
+  while (value >= 0x80) {
+    *dest++ = (u8)value | 0x80;
+    value >>= 7;
+  }
+
+  *dest++ = (u8)value;
+  return dest;
+}
+
+function const u8 *unpack_varint(const u8 *src, u64 *value) {
+  u64 result = 0;
+
+  for (u64 shift = 0;; shift += 7) {
+    u8 byte = *src++;
+    result |= (u64)(byte & 0x7f) << shift;
+
+    if (!(byte & 0x80))
+      break;
+  }
+
+  *value = result;
+  return src;
+}
+
+// Fill in a block's header, and return how many bytes it will take.
+function u64 measure_pack_block(pack_k mode, const u64 *values, u64 count,
+                                pack_block_t *header) {
+  if (mode == PACK_VARINT) {
+    u64 bytes = 0;
+
+    header->base = values[0];
+    header->width = 0;
+
+    for (u64 i = 1; i < count; i++) {
+      bytes += pack_varint_size(pack_zigzag(values[i] - values[i - 1]));
+    }
+
+    return bytes;
+  }
+
+  u64 min = values[0];
+  u64 max = values[0];
+
+  for (u64 i = 1; i < count; i++) {
+    min = values[i] < min ? values[i] : min;
+    max = values[i] > max ? values[i] : max;
+  }
+
+  header->base = min;
+  header->width = max == min ? 0 : 64 - __builtin_clzll(max - min);
+
+  return pack_bits_size(header->width);
+}
+
+function void write_pack_block(pack_k mode, const u64 *values, u64 count,
+                               pack_block_t *header, u8 *dest) {
+  if (mode == PACK_VARINT) {
+    for (u64 i = 1; i < count; i++) {
+      dest = pack_varint(dest, pack_zigzag(values[i] - values[i - 1]));
+    }
+
+    return;
+  }
+
+  u64 width = header->width;
+  u64 *words = cast(u64, dest);
+
+  memset(words, 0, pack_bits_size(width));
+
+  // Value r goes to lane r % PACK_LANES, at position r / PACK_LANES.
+  for (u64 r = 0; r < count && width; r++) {
+    u64 value = values[r] - header->base;
+    u64 lane = r % PACK_LANES;
+    u64 bit = r / PACK_LANES * width;
+    u64 word = bit / 64;
+    u64 shift = bit % 64;
+
+    words[word * PACK_LANES + lane] |= value << shift;
+
+    if (shift + width > 64)
+      words[(word + 1) * PACK_LANES + lane] |= value >> (64 - shift);
+  }
+}
+
+function result_t packed_create(view_t *view, pack_k mode) {
+  if (size(view) != sizeof(u64)) {
+    return err(CAST_ERR);
+  }
+
+  const u64 *values = cast(u64, view->data);
+
+  kind_t header_kind = {
+      .item_size = sizeof(pack_block_t),
+      .allocator = view->kind->allocator,
+      .user_name = "__internal_kind__",
+  };
+
+  kind_t data_kind = {
+      .item_size = 1,
+      .alignment = sizeof(u64),
+      .allocator = view->kind->allocator,
+      .user_name = "__internal_kind__",
+  };
+
+  packed_t *self =
+      unwrap(packed_t, alloc_bytes(&data_kind, NULL, sizeof(packed_t)));
+
+  self->header_kind = header_kind;
+  self->data_kind = data_kind;
+
+  self->mode = mode;
+  self->len = view->len;
+  self->blocks = (view->len + PACK_BLOCK - 1) / PACK_BLOCK;
+
+  // Measure every block first, so the data is allocated only once. Both
+  // allocations get one spare item, so an empty view still allocates.
+  self->headers = unwrap(
+      pack_block_t, alloc(&self->header_kind, NULL, self->blocks + 1));
+
+  u64 bytes = 0;
+
+  for (u64 b = 0; b < self->blocks; b++) {
+    u64 count = view->len - b * PACK_BLOCK;
+    count = count < PACK_BLOCK ? count : PACK_BLOCK;
+
+    self->headers[b].offset = bytes;
+    bytes += measure_pack_block(mode, values + b * PACK_BLOCK, count,
+                                &self->headers[b]);
+  }
+
+  self->data = unwrap(u8, alloc(&self->data_kind, NULL, bytes + 1));
+
+  for (u64 b = 0; b < self->blocks; b++) {
+    u64 count = view->len - b * PACK_BLOCK;
+    count = count < PACK_BLOCK ? count : PACK_BLOCK;
+
+    write_pack_block(mode, values + b * PACK_BLOCK, count, &self->headers[b],
+                     self->data + self->headers[b].offset);
+  }
+
+  return ok(self);
+}
+
+function result_t packed_from_array(array_t *array, pack_k mode) {
+  view_t view = {.kind = array->kind, .data = array->data, .len = array->len};
+
+  return packed_create(&view, mode);
+}
+
+function result_t packed_destroy(packed_t *self) {
+  alloc(&self->data_kind, self->data, 0);
+  alloc(&self->header_kind, self->headers, 0);
+  alloc(&self->data_kind, self, 0);
+
+  return ok(NULL);
+}
+
+function result_t packed_get(packed_t *self, u64 offset, u64 *value) {
+  if (offset >= self->len) {
+    return err(BOUNDS_ERR);
+  }
+
+  pack_block_t *header = &self->headers[offset / PACK_BLOCK];
+  const u8 *data = self->data + header->offset;
+  u64 r = offset % PACK_BLOCK;
+
+  if (self->mode == PACK_VARINT) {
+    u64 result = header->base;
+
+    for (u64 i = 0; i < r; i++) {
+      u64 zz;
+      data = unpack_varint(data, &zz);
+      result += pack_unzigzag(zz);
+    }
+
+    *value = result;
+    return ok(value);
+  }
+
+  u64 width = header->width;
+
+  if (width == 0) {
+    *value = header->base;
+    return ok(value);
+  }
+
+  const u64 *words = cast(u64, data);
+  u64 lane = r % PACK_LANES;
+  u64 bit = r / PACK_LANES * width;
+  u64 word = bit / 64;
+  u64 shift = bit % 64;
+
+  u64 result = words[word * PACK_LANES + lane] >> shift;
+
+  if (shift + width > 64)
+    result |= words[(word + 1) * PACK_LANES + lane] << (64 - shift);
+
+  *value = header->base + (result & pack_mask(width));
+  return ok(value);
+}
+
+function u64 packed_block(packed_t *self, u64 block, u64 *values) {
+  check(block < self->blocks, "Block should be in bounds");
+
+  pack_block_t *header = &self->headers[block];
+  const u8 *data = self->data + header->offset;
+
+  u64 count = self->len - block * PACK_BLOCK;
+  count = count < PACK_BLOCK ? count : PACK_BLOCK;
+
+  if (self->mode == PACK_VARINT) {
+    values[0] = header->base;
+
+    for (u64 i = 1; i < count; i++) {
+      u64 zz;
+      data = unpack_varint(data, &zz);
+      values[i] = values[i - 1] + pack_unzigzag(zz);
+    }
+
+    return count;
+  }
+
+  u64 width = header->width;
+  const u64 *words = cast(u64, data);
+
+  if (width == 0) {
+    for (u64 i = 0; i < count; i++) {
+      values[i] = header->base;
+    }
+
+    return count;
+  }
+
+  // Every lane sits at the same bit position, so each step unpacks
+  // PACK_LANES consecutive values.
+  for (u64 j = 0; j < PACK_BLOCK / PACK_LANES; j++) {
+    u64 bit = j * width;
+    u64 word = bit / 64;
+    u64 shift = bit % 64;
+    const u64 *lo = words + word * PACK_LANES;
+
+#if defined(__AVX2__)
+    __m256i result = _mm256_srl_epi64(_mm256_loadu_si256((const __m256i *)lo),
+                                      _mm_cvtsi64_si128(shift));
+
+    if (shift + width > 64) {
+      __m256i hi = _mm256_loadu_si256((const __m256i *)(lo + PACK_LANES));
+      result = _mm256_or_si256(
+          result, _mm256_sll_epi64(hi, _mm_cvtsi64_si128(64 - shift)));
+    }
+
+    result = _mm256_and_si256(result, _mm256_set1_epi64x(pack_mask(width)));
+    result = _mm256_add_epi64(result, _mm256_set1_epi64x(header->base));
+
+    _mm256_storeu_si256((__m256i *)(values + j * PACK_LANES), result);
+#elif defined(__SSE2__)
+    // Without AVX2, unpack the four lanes two at a time.
+    __m128i mask = _mm_set1_epi64x(pack_mask(width));
+    __m128i base = _mm_set1_epi64x(header->base);
+
+    for (u64 lane = 0; lane < PACK_LANES; lane += 2) {
+      __m128i low = _mm_loadu_si128((const __m128i *)(lo + lane));
+      __m128i result = _mm_srl_epi64(low, _mm_cvtsi64_si128(shift));
+
+      if (shift + width > 64) {
+        __m128i hi = _mm_loadu_si128((const __m128i *)(lo + PACK_LANES + lane));
+        result = _mm_or_si128(result,
+                              _mm_sll_epi64(hi, _mm_cvtsi64_si128(64 - shift)));
+      }
+
+      result = _mm_add_epi64(_mm_and_si128(result, mask), base);
+
+      _mm_storeu_si128((__m128i *)(values + j * PACK_LANES + lane), result);
+    }
+#else
+    for (u64 lane = 0; lane < PACK_LANES; lane++) {
+      u64 result = lo[lane] >> shift;
+
+      if (shift + width > 64)
+        result |= lo[PACK_LANES + lane] << (64 - shift);
+
+      values[j * PACK_LANES + lane] =
+          header->base + (result & pack_mask(width));
+    }
+#endif
+  }
+
+  return count;
+}
+
+#undef pack_unzigzag
+#undef pack_zigzag
+#undef pack_bits_size
+#undef pack_mask
+
+/* ------------ HEAPS ------------ */
+
+// Move the item at src into the slot at dest, keeping the handles in sync.
+function void move_heap(heap_t *self, u64 dest, u64 src) {
+  u64 width = self->items->kind->item_size;
+
+  memcpy(self->items->data + dest * width, self->items->data + src * width,
+         width);
+
+  if (self->ids) {
+    u64 *ids = cast(u64, self->ids->data);
+    ids[dest] = ids[src];
+    cast(u64, self->positions->data)[ids[dest]] = dest;
+  }
+}
+
+// Place the item at dest, taking it from scratch.
+function void place_heap(heap_t *self, u64 dest, u64 id) {
+  u64 width = self->items->kind->item_size;
+
+  memcpy(self->items->data + dest * width, self->scratch, width);
+
+  if (self->ids) {
+    cast(u64, self->ids->data)[dest] = id;
+    cast(u64, self->positions->data)[id] = dest;
+  }
+}
+
+// Sift the item in scratch up from the hole at index.
+function void sift_up_heap(heap_t *self, u64 index, u64 id) {
+  kind_t *kind = self->items->kind;
+  u8 *data = self->items->data;
+
+  while (index > 0) {
+    u64 parent = (index - 1) / HEAP_ARITY;
+
+    if (compare(kind, self->scratch, data + parent * kind->item_size) >= 0)
+      break;
+
+    move_heap(self, index, parent);
+    index = parent;
+  }
+
+  place_heap(self, index, id);
+}
+
+// Sift the item in scratch down from the hole at index.
+function void sift_down_heap(heap_t *self, u64 index, u64 id) {
+  kind_t *kind = self->items->kind;
+  u8 *data = self->items->data;
+  u64 len = self->items->len;
+
+  loop {
+    u64 first = index * HEAP_ARITY + 1;
+
+    if (first >= len)
+      break;
+
+    u64 last = first + HEAP_ARITY < len ? first + HEAP_ARITY : len;
+
+    // Find the smallest of the (up to) four children.
+    u64 best = first;
+    for (u64 child = first + 1; child < last; child++) {
+      if (compare(kind, data + child * kind->item_size,
+                  data + best * kind->item_size) < 0)
+        best = child;
+    }
+
+    if (compare(kind, data + best * kind->item_size, self->scratch) >= 0)
+      break;
+
+    move_heap(self, index, best);
+    index = best;
+  }
+
+  place_heap(self, index, id);
+}
+
+function result_t heap_create(kind_t *kind) {
+  assert(kind->comparer != NULL);
+
+  heap_t *self = unwrap(heap_t, alloc_bytes(kind, NULL, sizeof(heap_t)));
+
+  self->items = unwrap(array_t, array_create(kind));
+  self->scratch = unwrap(u8, alloc(kind, NULL, 1));
+  self->ids = NULL;
+  self->positions = NULL;
+  self->generations = NULL;
+  self->free_ids = NULL;
+
+  return ok(self);
+}
+
+function result_t heap_create_indexed(kind_t *kind) {
+  heap_t *self = unwrap(heap_t, heap_create(kind));
+
+  self->index_kind = (kind_t){
+      .item_size = sizeof(u64),
+      .allocator = kind->allocator,
+      .user_name = "__internal_kind__",
+  };
+
+  self->ids = unwrap(array_t, array_create(&self->index_kind));
+  self->positions = unwrap(array_t, array_create(&self->index_kind));
+  self->generations = unwrap(array_t, array_create(&self->index_kind));
+  self->free_ids = unwrap(array_t, array_create(&self->index_kind));
+
+  return ok(self);
+}
+
+function result_t heap_from_array(array_t *array) {
+  heap_t *self = unwrap(heap_t, heap_create(array->kind));
+
+  while (self->items->cap < array->len) {
+    try(grow_array(self->items));
+  }
+
+  copy(array->kind, self->items->data, array->data, array->len);
+  self->items->len = array->len;
+
+  // Sift down every parent, starting from the last one.
+  for (u64 i = array->len / HEAP_ARITY + 1; i-- > 0;) {
+    if (i * HEAP_ARITY + 1 >= array->len)
+      continue;
+
+    copy(array->kind, self->scratch, self->items->data + i * size(array), 1);
+    sift_down_heap(self, i, 0);
+  }
+
+  return ok(self);
+}
+
+function result_t heap_destroy(heap_t *self) {
+  kind_t *kind = self->items->kind;
+
+  if (self->ids) {
+    array_destroy(self->ids);
+    array_destroy(self->positions);
+    array_destroy(self->generations);
+    array_destroy(self->free_ids);
+  }
+
+  array_destroy(self->items);
+  alloc(kind, self->scratch, 0);
+  alloc(kind, self, 0);
+
+  return ok(NULL);
+}
+
+function result_t heap_insert(heap_t *self, void *item, u64 *handle) {
+  if (!self->ids) {
+    return err(CAST_ERR);
+  }
+
+  u64 id;
+
+  if (self->free_ids->len) {
+    id = *unwrap(u64, array_pop(self->free_ids));
+  } else {
+    u64 generation = 0;
+
+    id = self->positions->len;
+    try(array_append(self->positions));
+    try(array_emplace(self->generations, &generation));
+  }
+
+  try(array_append(self->ids));
+  try(array_append(self->items));
+
+  copy(self->items->kind, self->scratch, item, 1);
+  sift_up_heap(self, self->items->len - 1, id);
+
+  if (handle)
+    *handle = cast(u64, self->generations->data)[id] << HEAP_SLOT_BITS | id;
+
+  return ok(NULL);
+}
+
+function result_t heap_push(heap_t *self, void *item) {
+  if (self->ids) {
+    return heap_insert(self, item, NULL);
+  }
+
+  try(array_append(self->items));
+
+  copy(self->items->kind, self->scratch, item, 1);
+  sift_up_heap(self, self->items->len - 1, 0);
+
+  return ok(NULL);
+}
+
+function result_t heap_peek(heap_t *self) {
+  if (self->items->len == 0) {
+    return err(BOUNDS_ERR);
+  }
+
+  return ok(self->items->data);
+}
+
+function result_t heap_pop(heap_t *self) {
+  array_t *items = self->items;
+
+  if (items->len == 0) {
+    return err(BOUNDS_ERR);
+  }
+
+  u64 last = items->len - 1;
+  u8 *parked = items->data + last * size(items);
+  u64 id = 0;
+
+  if (self->ids) {
+    u64 *ids = cast(u64, self->ids->data);
+    cast(u64, self->positions->data)[ids[0]] = HEAP_NONE;
+    cast(u64, self->generations->data)[ids[0]]++;
+    try(array_emplace(self->free_ids, &ids[0]));
+    id = ids[last];
+    self->ids->len--;
+  }
+
+  // Park the root just past the end, and sift the last item down from it.
+  copy(items->kind, self->scratch, parked, 1);
+  copy(items->kind, parked, items->data, 1);
+  items->len--;
+
+  if (last > 0)
+    sift_down_heap(self, 0, id);
+
+  return ok(parked);
+}
+
+function result_t heap_decrease(heap_t *self, u64 handle, void *item) {
+  u64 id = handle & (((u64)1 << HEAP_SLOT_BITS) - 1);
+
+  if (!self->ids || id >= self->positions->len) {
+    return err(BOUNDS_ERR);
+  }
+
+  // A handle from before its slot was reused no longer names an item.
+  u64 generation = handle >> HEAP_SLOT_BITS;
+
+  if (generation != cast(u64, self->generations->data)[id]) {
+    return err(BOUNDS_ERR);
+  }
+
+  u64 index = cast(u64, self->positions->data)[id];
+
+  if (index == HEAP_NONE) {
+    return err(BOUNDS_ERR);
+  }
+
+  kind_t *kind = self->items->kind;
+  u64 parent = index > 0 ? (index - 1) / HEAP_ARITY : 0;
+
+  copy(kind, self->scratch, item, 1);
+
+  // A larger item is allowed too, it just has to sift the other way.
+  if (index > 0 && compare(kind, self->scratch,
+                           self->items->data + parent * kind->item_size) < 0)
+    sift_up_heap(self, index, id);
+  else
+    sift_down_heap(self, index, id);
+
+  return ok(NULL);
 }
 
 /* ------------ VECTORS ------------ */